@@ -0,0 +1,618 @@
+#include "dsp_image.h"
+#include <stdio.h>
+#include <string.h>  //memcmp
+#include "i2c.h"
+#include "i2c_sched.h"
+#include "system_files/SigmaStudioFW.h"
+
+#define LZ_MIN_MATCH   4
+#define LZ_MAX_OFFSET  0xFFFF
+#define LZ_HASH_BITS   12
+#define RLE_MAX_RUN    128
+#define HEADER_BYTES   5   // magic + version
+#define BLOCK_HDR      13  // type, addr8, reg, codec, raw_len, comp_len, crc
+#define DELAY_HDR      8   // type, addr8, len, crc
+#define END_BYTES      5   // type, image crc
+#define DELAY_MIN_LEN  2   // SIGMA_WRITE_DELAY reads pData[1]
+
+static const unsigned char MAGIC[4] = {'A', 'D', 'S', 'P'};
+static const char *CODEC_NAMES[DSP_IMAGE_N_CODECS] = {"raw", "rle", "lz"};
+
+// Image being recorded, NULL when not packing
+static FILE *g_pack_file = NULL;
+static int g_pack_error = 0;
+static uint32_t g_pack_crc;
+static dsp_image_stats_t g_pack_stats;
+
+// Work buffers. Encoding needs one output buffer per codec.
+// Decoding uses only g_msg, the reg addr followed by the data, sent as is to the dsp.
+static unsigned char g_msg[I2C_REG_SIZE + I2C_CHUNK_MAX];
+static unsigned char g_rle_buf[I2C_CHUNK_MAX];
+static unsigned char g_lz_buf[I2C_CHUNK_MAX];
+static int g_lz_hash[1 << LZ_HASH_BITS];
+static uint32_t g_crc_table[256];
+
+// function prototypes
+static int check_image(FILE *f, const char *path);
+static int pack_chunk(int devAddress8, int address, const unsigned char *data, unsigned short length);
+static int rle_encode(const unsigned char *in, int in_len, unsigned char *out, int out_cap);
+static int lz_encode(const unsigned char *in, int in_len, unsigned char *out, int out_cap);
+static int lz_put_length(unsigned char *out, int pos, int out_cap, int len);
+static int rle_decode(FILE *f, unsigned short comp_len, unsigned char *out, unsigned short raw_len);
+static int lz_decode(FILE *f, unsigned short comp_len, unsigned char *out, unsigned short raw_len);
+static int get_byte(FILE *f, unsigned short *remains);
+static int get_length(FILE *f, unsigned short *remains, int nibble);
+static int put_bytes(const unsigned char *buf, int len);
+static void set_u16(unsigned char *buf, unsigned short val);
+static void set_u32(unsigned char *buf, uint32_t val);
+static unsigned short get_u16(const unsigned char *buf);
+static uint32_t get_u32(const unsigned char *buf);
+static uint32_t crc32_update(uint32_t crc, const unsigned char *buf, unsigned int len);
+
+int dsp_image_pack_begin(const char *path){
+    unsigned char version = DSP_IMAGE_VERSION;
+
+    if (g_pack_file) {
+        fprintf(stderr, "ERROR, dsp_image_pack_begin: already packing\n");
+        return 1;
+    }
+    g_pack_file = fopen(path, "wb");
+    if (g_pack_file == NULL) {
+        perror("dsp_image_pack_begin");
+        return 1;
+    }
+    memset(&g_pack_stats, 0, sizeof(g_pack_stats));
+    g_pack_error = 0;
+    g_pack_crc = 0;
+    if (put_bytes(MAGIC, sizeof(MAGIC)) || put_bytes(&version, 1)) {
+        fprintf(stderr, "ERROR, failed to write dsp image\n");
+        fclose(g_pack_file);
+        g_pack_file = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+int dsp_image_is_packing(void){
+    return g_pack_file != NULL;
+}
+
+int dsp_image_pack_block(int devAddress8, int address, int length, const unsigned char *pData){
+    int sent = 0;
+    unsigned short length_to_send;
+
+    if (g_pack_file == NULL) {
+        return 1;
+    }
+    while (!g_pack_error && sent < length) {
+        length_to_send = (length - sent > I2C_CHUNK_MAX) ? I2C_CHUNK_MAX : (unsigned short)(length - sent);
+        g_pack_error = pack_chunk(devAddress8, address + sent/DSP_WORD, pData + sent, length_to_send);
+        sent += length_to_send;
+    }
+    return g_pack_error;
+}
+
+int dsp_image_pack_delay(int devAddress8, int length, const unsigned char *pData){
+    unsigned char hdr[DELAY_HDR];
+
+    if (g_pack_file == NULL) {
+        return 1;
+    }
+    if (length < DELAY_MIN_LEN || length > I2C_CHUNK_MAX) {
+        fprintf(stderr, "ERROR, dsp_image_pack_delay: bad length %d\n", length);
+        g_pack_error = 1;
+        return 1;
+    }
+    hdr[0] = DSP_IMAGE_REC_DELAY;
+    hdr[1] = (unsigned char)devAddress8;
+    set_u16(&hdr[2], (unsigned short)length);
+    set_u32(&hdr[4], crc32_update(crc32_update(0, &hdr[1], 3), pData, length));
+    if (put_bytes(hdr, DELAY_HDR) || put_bytes(pData, length)) {
+        g_pack_error = 1;
+    }
+    return g_pack_error;
+}
+
+int dsp_image_pack_end(dsp_image_stats_t *stats){
+    unsigned char end[END_BYTES];
+    int err;
+
+    if (g_pack_file == NULL) {
+        return 1;
+    }
+    // the image crc covers everything before it, incl. the END type byte
+    end[0] = DSP_IMAGE_REC_END;
+    set_u32(&end[1], crc32_update(g_pack_crc, end, 1));
+    if (put_bytes(end, END_BYTES)) {
+        g_pack_error = 1;
+    }
+    if (fclose(g_pack_file)) {
+        g_pack_error = 1;
+    }
+    g_pack_file = NULL;
+
+    err = g_pack_error;
+    if (err) {
+        fprintf(stderr, "ERROR, failed to write dsp image\n");
+    }
+    if (stats) {
+        *stats = g_pack_stats;
+    }
+    return err;
+}
+
+int dsp_image_load(const char *path, int dry_run, dsp_image_stats_t *stats){
+    FILE *f;
+    unsigned char hdr[BLOCK_HDR];
+    unsigned char *data = &g_msg[I2C_REG_SIZE];
+    int rec_type, addr8, codec;
+    unsigned short reg, raw_len, comp_len;
+    uint64_t start;
+    int isError = 0;
+    int busError = 0;
+    int done = 0;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        perror("dsp_image_load");
+        return 1;
+    }
+    // first pass, nothing is sent to the dsp unless the whole image is intact
+    if (check_image(f, path)) {
+        fclose(f);
+        return 1;
+    }
+    if (stats) {
+        stats->image_bytes += HEADER_BYTES;
+    }
+
+    while (!isError && !busError && !done) {
+        rec_type = fgetc(f);
+        switch (rec_type) {
+            case DSP_IMAGE_REC_BLOCK:
+                if (fread(&hdr[1], 1, BLOCK_HDR - 1, f) != BLOCK_HDR - 1) {
+                    isError = 1;
+                    break;
+                }
+                addr8 = hdr[1];
+                reg = get_u16(&hdr[2]);
+                codec = hdr[4];
+                raw_len = get_u16(&hdr[5]);
+                comp_len = get_u16(&hdr[7]);
+                if (raw_len > I2C_CHUNK_MAX) {
+                    fprintf(stderr, "ERROR, dsp image block too large: %d\n", raw_len);
+                    isError = 1;
+                    break;
+                }
+
+                start = i2c_sched_now_ns();
+                switch (codec) {
+                    case DSP_IMAGE_CODEC_RAW:
+                        isError = comp_len != raw_len || fread(data, 1, raw_len, f) != raw_len;
+                        break;
+                    case DSP_IMAGE_CODEC_RLE:
+                        isError = rle_decode(f, comp_len, data, raw_len);
+                        break;
+                    case DSP_IMAGE_CODEC_LZ:
+                        isError = lz_decode(f, comp_len, data, raw_len);
+                        break;
+                    default:
+                        fprintf(stderr, "ERROR, unknown dsp image codec: %d\n", codec);
+                        isError = 1;
+                        break;
+                }
+                if (isError) {
+                    break;
+                }
+                // block crc covers the record fields and the decoded data
+                if (crc32_update(crc32_update(0, &hdr[1], 8), data, raw_len) != get_u32(&hdr[9])) {
+                    fprintf(stderr, "ERROR, dsp image block crc mismatch, reg: 0x%04x\n", reg);
+                    isError = 1;
+                    break;
+                }
+                if (stats) {
+                    stats->decode_ns += i2c_sched_now_ns() - start;
+                    stats->raw_bytes += raw_len;
+                    stats->image_bytes += BLOCK_HDR + comp_len;
+                    stats->n_blocks[codec]++;
+                }
+
+                // data is already in place after the reg addr, send the message as is
+                g_msg[0] = (unsigned char)((reg >> 8) & 0xFF);
+                g_msg[1] = (unsigned char)(reg & 0xFF);
+                if (!dry_run && i2c_sched_write_raw(I2C_SCHED_BULK, (unsigned char)(addr8>>1),
+                                                    g_msg, I2C_REG_SIZE + raw_len)) {
+                    fprintf(stderr, "ERROR, failed to write reg 0x%04x to dsp 0x%02x\n", reg, addr8);
+                    busError = 1;
+                }
+                break;
+            case DSP_IMAGE_REC_DELAY:
+                if (fread(&hdr[1], 1, DELAY_HDR - 1, f) != DELAY_HDR - 1) {
+                    isError = 1;
+                    break;
+                }
+                addr8 = hdr[1];
+                raw_len = get_u16(&hdr[2]);
+                if (raw_len < DELAY_MIN_LEN || raw_len > I2C_CHUNK_MAX || fread(data, 1, raw_len, f) != raw_len
+                    || crc32_update(crc32_update(0, &hdr[1], 3), data, raw_len) != get_u32(&hdr[4])) {
+                    isError = 1;
+                    break;
+                }
+                if (stats) {
+                    stats->image_bytes += DELAY_HDR + raw_len;
+                }
+                if (!dry_run) {
+                    SIGMA_WRITE_DELAY(addr8, raw_len, data);
+                }
+                break;
+            case DSP_IMAGE_REC_END:
+                // image crc was checked in the first pass, it must be the last thing in the file
+                if (fread(hdr, 1, END_BYTES - 1, f) != END_BYTES - 1 || fgetc(f) != EOF) {
+                    isError = 1;
+                    break;
+                }
+                if (stats) {
+                    stats->image_bytes += END_BYTES;
+                }
+                done = 1;
+                break;
+            default:
+                isError = 1;
+                break;
+        }
+    }
+    if (isError) {
+        fprintf(stderr, "ERROR, corrupt or truncated dsp image: %s\n", path);
+    }
+
+    fclose(f);
+    return isError || busError;
+}
+
+void dsp_image_print_stats(const dsp_image_stats_t *stats){
+    printf("dsp image: %llu bytes of register data in %llu bytes, ratio %.2f\n",
+           (unsigned long long)stats->raw_bytes,
+           (unsigned long long)stats->image_bytes,
+           stats->image_bytes ? (double)stats->raw_bytes/stats->image_bytes : 0.0);
+    for (int codec = 0; codec < DSP_IMAGE_N_CODECS; codec++) {
+        printf("  %-3s blocks: %llu\n", CODEC_NAMES[codec], (unsigned long long)stats->n_blocks[codec]);
+    }
+    if (stats->decode_ns) {
+        printf("  decoding: %.3f ms, %.1f MB/s\n",
+               (double)stats->decode_ns/1e6,
+               (double)stats->raw_bytes/1e6/((double)stats->decode_ns/1e9));
+    }
+}
+
+/*
+ * Check magic, version and the image crc (last 4 bytes, over everything before them).
+ * Reads the file in g_msg sized pieces. Leaves f positioned at the first record.
+ */
+static int check_image(FILE *f, const char *path){
+    unsigned char tail[4];
+    long size, pos;
+    size_t n;
+    uint32_t crc = 0;
+
+    if (fread(g_msg, 1, HEADER_BYTES, f) != HEADER_BYTES || memcmp(g_msg, MAGIC, sizeof(MAGIC))
+        || g_msg[sizeof(MAGIC)] != DSP_IMAGE_VERSION) {
+        fprintf(stderr, "ERROR, %s is not a version %d dsp image\n", path, DSP_IMAGE_VERSION);
+        return 1;
+    }
+    if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < HEADER_BYTES + END_BYTES || fseek(f, 0, SEEK_SET)) {
+        fprintf(stderr, "ERROR, truncated dsp image: %s\n", path);
+        return 1;
+    }
+    for (pos = 0; pos < size - 4; pos += (long)n) {
+        n = sizeof(g_msg);
+        if ((long)n > size - 4 - pos) {
+            n = (size_t)(size - 4 - pos);
+        }
+        if (fread(g_msg, 1, n, f) != n) {
+            return 1;
+        }
+        crc = crc32_update(crc, g_msg, (unsigned int)n);
+    }
+    if (fread(tail, 1, sizeof(tail), f) != sizeof(tail) || get_u32(tail) != crc) {
+        fprintf(stderr, "ERROR, dsp image crc mismatch: %s\n", path);
+        return 1;
+    }
+    return fseek(f, HEADER_BYTES, SEEK_SET) != 0;
+}
+
+// Compress one chunk with the codec that gives the smallest payload and write its record
+static int pack_chunk(int devAddress8, int address, const unsigned char *data, unsigned short length){
+    unsigned char hdr[BLOCK_HDR];
+    int codec = DSP_IMAGE_CODEC_RAW;
+    const unsigned char *payload = data;
+    int payload_len = length;
+    int rle_len, lz_len;
+
+    // Only worth it if smaller than raw, so raw length is the output cap (-1 = did not fit)
+    rle_len = rle_encode(data, length, g_rle_buf, length - 1);
+    lz_len = lz_encode(data, length, g_lz_buf, length - 1);
+    if (rle_len >= 0 && rle_len < payload_len) {
+        codec = DSP_IMAGE_CODEC_RLE;
+        payload = g_rle_buf;
+        payload_len = rle_len;
+    }
+    if (lz_len >= 0 && lz_len < payload_len) {
+        codec = DSP_IMAGE_CODEC_LZ;
+        payload = g_lz_buf;
+        payload_len = lz_len;
+    }
+
+    hdr[0] = DSP_IMAGE_REC_BLOCK;
+    hdr[1] = (unsigned char)devAddress8;
+    set_u16(&hdr[2], (unsigned short)address);
+    hdr[4] = (unsigned char)codec;
+    set_u16(&hdr[5], length);
+    set_u16(&hdr[7], (unsigned short)payload_len);
+    set_u32(&hdr[9], crc32_update(crc32_update(0, &hdr[1], 8), data, length));
+    if (put_bytes(hdr, BLOCK_HDR) || put_bytes(payload, payload_len)) {
+        return 1;
+    }
+
+    g_pack_stats.raw_bytes += length;
+    g_pack_stats.n_blocks[codec]++;
+    return 0;
+}
+
+// return the encoded length, or -1 if it does not fit in out_cap
+static int rle_encode(const unsigned char *in, int in_len, unsigned char *out, int out_cap){
+    int i = 0, o = 0, run;
+
+    while (i < in_len) {
+        run = 0;
+        if (in[i] == 0) {
+            while (i + run < in_len && in[i + run] == 0 && run < RLE_MAX_RUN) {
+                run++;
+            }
+            if (o + 1 > out_cap) {
+                return -1;
+            }
+            out[o++] = (unsigned char)(0x80 | (run - 1));
+        } else {
+            // literals up to the next run of at least 2 zeros, a single zero is cheaper as a literal
+            while (i + run < in_len && run < RLE_MAX_RUN
+                   && !(in[i + run] == 0 && (i + run + 1 == in_len || in[i + run + 1] == 0))) {
+                run++;
+            }
+            if (o + 1 + run > out_cap) {
+                return -1;
+            }
+            out[o++] = (unsigned char)(run - 1);
+            memcpy(&out[o], &in[i], run);
+            o += run;
+        }
+        i += run;
+    }
+    return o;
+}
+
+// return the encoded length, or -1 if it does not fit in out_cap
+static int lz_encode(const unsigned char *in, int in_len, unsigned char *out, int out_cap){
+    int i = 0, anchor = 0, o = 0;
+    int cand, match_len, lit_len;
+    uint32_t seq, h;
+
+    for (h = 0; h < (1 << LZ_HASH_BITS); h++) {
+        g_lz_hash[h] = -1;
+    }
+
+    while (i + LZ_MIN_MATCH <= in_len) {
+        seq = (uint32_t)in[i] | (uint32_t)in[i+1] << 8 | (uint32_t)in[i+2] << 16 | (uint32_t)in[i+3] << 24;
+        h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        cand = g_lz_hash[h];
+        g_lz_hash[h] = i;
+        if (cand < 0 || i - cand > LZ_MAX_OFFSET || memcmp(&in[cand], &in[i], LZ_MIN_MATCH)) {
+            i++;
+            continue;
+        }
+
+        match_len = LZ_MIN_MATCH;
+        while (i + match_len < in_len && in[cand + match_len] == in[i + match_len]) {
+            match_len++;
+        }
+        lit_len = i - anchor;
+
+        // token, literal length, literals, offset, match length
+        if (o + 1 > out_cap) {
+            return -1;
+        }
+        out[o++] = (unsigned char)(((lit_len < 15 ? lit_len : 15) << 4)
+                                   | (match_len - LZ_MIN_MATCH < 15 ? match_len - LZ_MIN_MATCH : 15));
+        if (lit_len >= 15 && (o = lz_put_length(out, o, out_cap, lit_len - 15)) < 0) {
+            return -1;
+        }
+        if (o + lit_len + 2 > out_cap) {
+            return -1;
+        }
+        memcpy(&out[o], &in[anchor], lit_len);
+        o += lit_len;
+        out[o++] = (unsigned char)(((i - cand) >> 8) & 0xFF);
+        out[o++] = (unsigned char)((i - cand) & 0xFF);
+        if (match_len - LZ_MIN_MATCH >= 15
+            && (o = lz_put_length(out, o, out_cap, match_len - LZ_MIN_MATCH - 15)) < 0) {
+            return -1;
+        }
+
+        i += match_len;
+        anchor = i;
+    }
+
+    // last sequence, literals only
+    lit_len = in_len - anchor;
+    if (lit_len > 0) {
+        if (o + 1 > out_cap) {
+            return -1;
+        }
+        out[o++] = (unsigned char)((lit_len < 15 ? lit_len : 15) << 4);
+        if (lit_len >= 15 && (o = lz_put_length(out, o, out_cap, lit_len - 15)) < 0) {
+            return -1;
+        }
+        if (o + lit_len > out_cap) {
+            return -1;
+        }
+        memcpy(&out[o], &in[anchor], lit_len);
+        o += lit_len;
+    }
+    return o;
+}
+
+// Write the extension bytes of a length, return the new output position or -1 if out of space
+static int lz_put_length(unsigned char *out, int pos, int out_cap, int len){
+    while (len >= 255) {
+        if (pos + 1 > out_cap) {
+            return -1;
+        }
+        out[pos++] = 255;
+        len -= 255;
+    }
+    if (pos + 1 > out_cap) {
+        return -1;
+    }
+    out[pos++] = (unsigned char)len;
+    return pos;
+}
+
+static int rle_decode(FILE *f, unsigned short comp_len, unsigned char *out, unsigned short raw_len){
+    unsigned short remains = comp_len;
+    int o = 0, c, run, val;
+
+    while (remains) {
+        if ((c = get_byte(f, &remains)) < 0) {
+            return 1;
+        }
+        run = (c & 0x7F) + 1;
+        if (o + run > raw_len) {
+            return 1;
+        }
+        if (c & 0x80) {
+            memset(&out[o], 0, run);
+            o += run;
+        } else {
+            while (run--) {
+                if ((val = get_byte(f, &remains)) < 0) {
+                    return 1;
+                }
+                out[o++] = (unsigned char)val;
+            }
+        }
+    }
+    return o != raw_len;
+}
+
+static int lz_decode(FILE *f, unsigned short comp_len, unsigned char *out, unsigned short raw_len){
+    unsigned short remains = comp_len;
+    int o = 0, token, lit_len, match_len, offset, hi, lo, val;
+
+    while (remains) {
+        if ((token = get_byte(f, &remains)) < 0 || (lit_len = get_length(f, &remains, token >> 4)) < 0) {
+            return 1;
+        }
+        if (o + lit_len > raw_len) {
+            return 1;
+        }
+        while (lit_len--) {
+            if ((val = get_byte(f, &remains)) < 0) {
+                return 1;
+            }
+            out[o++] = (unsigned char)val;
+        }
+        if (remains == 0) {
+            break;  // last sequence
+        }
+
+        if ((hi = get_byte(f, &remains)) < 0 || (lo = get_byte(f, &remains)) < 0
+            || (match_len = get_length(f, &remains, token & 0x0F)) < 0) {
+            return 1;
+        }
+        offset = hi << 8 | lo;
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || o + match_len > raw_len) {
+            return 1;
+        }
+        // byte by byte, the match may overlap the bytes it produces
+        while (match_len--) {
+            out[o] = out[o - offset];
+            o++;
+        }
+    }
+    return o != raw_len;
+}
+
+// Next payload byte, or -1 if the payload or the file ends
+static int get_byte(FILE *f, unsigned short *remains){
+    int c;
+
+    if (*remains == 0 || (c = fgetc(f)) == EOF) {
+        return -1;
+    }
+    (*remains)--;
+    return c;
+}
+
+// Length from a token nibble plus its extension bytes, or -1 on error
+static int get_length(FILE *f, unsigned short *remains, int nibble){
+    int len = nibble, c;
+
+    if (nibble == 15) {
+        do {
+            if ((c = get_byte(f, remains)) < 0 || len > I2C_CHUNK_MAX) {
+                return -1;
+            }
+            len += c;
+        } while (c == 255);
+    }
+    return len;
+}
+
+
+// Write to the image being packed, keeping the image crc and size up to date
+static int put_bytes(const unsigned char *buf, int len){
+    if (fwrite(buf, 1, len, g_pack_file) != (size_t)len) {
+        return 1;
+    }
+    g_pack_crc = crc32_update(g_pack_crc, buf, len);
+    g_pack_stats.image_bytes += len;
+    return 0;
+}
+
+static void set_u16(unsigned char *buf, unsigned short val){
+    buf[0] = (unsigned char)((val >> 8) & 0xFF);
+    buf[1] = (unsigned char)(val & 0xFF);
+}
+
+static void set_u32(unsigned char *buf, uint32_t val){
+    set_u16(&buf[0], (unsigned short)(val >> 16));
+    set_u16(&buf[2], (unsigned short)(val & 0xFFFF));
+}
+
+static unsigned short get_u16(const unsigned char *buf){
+    return (unsigned short)(buf[0] << 8 | buf[1]);
+}
+
+static uint32_t get_u32(const unsigned char *buf){
+    return (uint32_t)get_u16(&buf[0]) << 16 | get_u16(&buf[2]);
+}
+
+// CRC-32 (IEEE 802.3, as zlib), start with crc = 0 and feed the data in any number of pieces
+static uint32_t crc32_update(uint32_t crc, const unsigned char *buf, unsigned int len){
+    uint32_t c;
+
+    if (g_crc_table[1] == 0) {
+        for (uint32_t n = 0; n < 256; n++) {
+            c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            g_crc_table[n] = c;
+        }
+    }
+    c = crc ^ 0xFFFFFFFFu;
+    while (len--) {
+        c = g_crc_table[(c ^ *buf++) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
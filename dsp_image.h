@@ -0,0 +1,121 @@
+/*
+ * dsp_image.h
+ *
+ *  Compressed container for the dsp configuration defined by the SigmaStudio system files
+ *
+ *  Instead of writing to the dsp, the generated default_download_IC_x() functions can be
+ *  run in pack mode. Every SIGMA_WRITE_REGISTER_BLOCK and SIGMA_WRITE_DELAY call is then
+ *  recorded in an image file, that later can be loaded to the dsp without the system files.
+ *
+ *  File layout, multi byte values are big endian like the dsp reg addr:
+ *  0..3 : magic "ADSP"
+ *  4    : version, DSP_IMAGE_VERSION
+ *  5..  : records, each starting with a record type byte
+ *         DSP_IMAGE_REC_BLOCK : addr8 (1), reg (2), codec (1), raw_len (2), comp_len (2), crc (4), payload
+ *         DSP_IMAGE_REC_DELAY : addr8 (1), len (2), crc (4), data
+ *         DSP_IMAGE_REC_END   : image crc (4)
+ *
+ *  All crc:s are CRC-32 (as zlib). A block/delay crc covers the record fields from addr8 up to
+ *  the crc, followed by the decoded data. The image crc covers every byte before it in the file.
+ *  dsp_image_load checks the image crc in a first pass, so a corrupt image is rejected before
+ *  anything is sent to the dsp, and then every block crc again before the block is sent.
+ *
+ *  Register blocks are split up into blocks of at most I2C_CHUNK_MAX bytes (the reg addr
+ *  advanced one step per dsp word, same as write_i2c_block_data does), and every block
+ *  is compressed on its own with the codec that gives the smallest payload:
+ *  DSP_IMAGE_CODEC_RAW : payload is the data as is
+ *  DSP_IMAGE_CODEC_RLE : control byte c, c & 0x80 -> (c & 0x7f)+1 zeros, else c+1 literal bytes follow
+ *  DSP_IMAGE_CODEC_LZ  : LZ77 sequences, token (literal len << 4 | match len - 4), literal len
+ *                        extension bytes, literals, offset (2), match len extension bytes.
+ *                        A length nibble of 15 is followed by extension bytes that are added
+ *                        until a byte < 255. The last sequence has no offset/match.
+ *
+ *  Since a block never refers to data outside itself, loading decodes each block straight
+ *  into the data part of a single static i2c message buffer (I2C_REG_SIZE + I2C_CHUNK_MAX),
+ *  fills in the reg addr and sends it with i2c_sched_write_raw, without any copy or malloc.
+ *  Peak memory when loading is that one message buffer plus the stdio FILE buffer, whatever
+ *  the image size.
+ */
+
+#ifndef ADI_DSP_PROGRAMMER_DSP_IMAGE_H
+#define ADI_DSP_PROGRAMMER_DSP_IMAGE_H
+#include <stdint.h>
+
+#define DSP_IMAGE_VERSION 2
+
+enum {
+    DSP_IMAGE_REC_END = 0,
+    DSP_IMAGE_REC_BLOCK,
+    DSP_IMAGE_REC_DELAY
+};
+
+enum {
+    DSP_IMAGE_CODEC_RAW = 0,
+    DSP_IMAGE_CODEC_RLE,
+    DSP_IMAGE_CODEC_LZ,
+    DSP_IMAGE_N_CODECS
+};
+
+typedef struct {
+    uint64_t raw_bytes;                     // register data bytes, uncompressed
+    uint64_t image_bytes;                   // image file bytes, incl. headers
+    uint64_t n_blocks[DSP_IMAGE_N_CODECS];  // number of blocks per codec
+    uint64_t decode_ns;                     // time spent decoding blocks, only set by dsp_image_load
+} dsp_image_stats_t;
+
+/*
+ * Start recording register writes to the image file at path.
+ * While recording, SIGMA_WRITE_REGISTER_BLOCK and SIGMA_WRITE_DELAY do not touch the dsp.
+ *
+ * return 0 upon success
+ */
+extern int dsp_image_pack_begin(const char *path);
+
+/*
+ * return 1 if register writes are being recorded, else 0
+ */
+extern int dsp_image_is_packing(void);
+
+/*
+ * Record a register block write, same params as SIGMA_WRITE_REGISTER_BLOCK
+ *
+ * return 0 upon success
+ */
+extern int dsp_image_pack_block(int devAddress8, int address, int length, const unsigned char *pData);
+
+/*
+ * Record a delay, same params as SIGMA_WRITE_DELAY. length must be at least 2,
+ * SIGMA_WRITE_DELAY picks the delay from pData[1].
+ *
+ * return 0 upon success
+ */
+extern int dsp_image_pack_delay(int devAddress8, int length, const unsigned char *pData);
+
+/*
+ * Stop recording and close the image file
+ *
+ * param stats, if not NULL, gets the sizes and codec usage of the image
+ *
+ * return 0 upon success
+ */
+extern int dsp_image_pack_end(dsp_image_stats_t *stats);
+
+/*
+ * Load an image file to the dsp. i2cOpen() must have been called unless dry_run is set.
+ *
+ * param path, the image file
+ *
+ * param dry_run, if set, the image is decoded but nothing is sent to the dsp and no delays are made
+ *
+ * param stats, if not NULL, the sizes, codec usage and decoding time are ADDED to *stats
+ *
+ * return 0 upon success
+ */
+extern int dsp_image_load(const char *path, int dry_run, dsp_image_stats_t *stats);
+
+/*
+ * Print compression ratio, codec usage and (if decode_ns is set) decoding speed to stdout
+ */
+extern void dsp_image_print_stats(const dsp_image_stats_t *stats);
+
+#endif //ADI_DSP_PROGRAMMER_DSP_IMAGE_H
@@ -12,14 +12,16 @@
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <errno.h>
-#include "i2c.h"
+#include <pthread.h>
 
 #define I2C_BUS "/dev/i2c-1"
-#define REG_SIZE 2     //number of bytes for a dsp register address
+#define REG_SIZE I2C_REG_SIZE
 // todo: how set baudrate? max 400kHz
 
 // I2C Linux device handle
 static int g_i2cFile;
+// Serializes open/close and every ioctl on g_i2cFile between threads
+static pthread_mutex_t g_i2cLock = PTHREAD_MUTEX_INITIALIZER;
 
 // function prototypes
 static int send_data(struct i2c_rdwr_ioctl_data* packets);
@@ -29,17 +31,21 @@ static int set_reg_addr(unsigned short reg, unsigned char* outbuf, unsigned shor
 int i2cOpen(){
     static int initDone = 0;
 
+    pthread_mutex_lock(&g_i2cLock);
     if (initDone) {
+        pthread_mutex_unlock(&g_i2cLock);
         return 0;
     }
 
     g_i2cFile = open(I2C_BUS, O_RDWR);
     if (g_i2cFile < 0) {
         perror("i2cOpen");
+        pthread_mutex_unlock(&g_i2cLock);
         return 1;
     }
 
     initDone = 1;
+    pthread_mutex_unlock(&g_i2cLock);
 
     return 0;
 }
@@ -47,7 +53,9 @@ int i2cOpen(){
 // close the Linux device
 int i2cClose(){
     printf("Closing...\n");
+    pthread_mutex_lock(&g_i2cLock);
     close(g_i2cFile);
+    pthread_mutex_unlock(&g_i2cLock);
     return 0;
 }
 
@@ -178,8 +186,7 @@ int write_i2c_block_data(
         const unsigned char *val,
         unsigned short val_length)
 {
-    const unsigned char DSP_WORD = 4;  // i.e. 4 bytes
-    const unsigned short VAL_LENGTH_MAX = 8188;//1024;//8188; // must be a value divisible with 4, ie 8188
+    const unsigned short VAL_LENGTH_MAX = I2C_CHUNK_MAX; // must be a value divisible with 4, ie 8188
     unsigned char isError = 0;
     unsigned short outbuf_size = REG_SIZE + val_length;  //reg is 2 bytes
     unsigned char* outbuf;
@@ -261,7 +268,12 @@ static int send_data(struct i2c_rdwr_ioctl_data* packets) {
      * packets.msgs  = messages;
      * packets.nmsgs = 1;
      * */
-    if(ioctl(g_i2cFile, I2C_RDWR, packets) < 0) {
+    int ret;
+
+    pthread_mutex_lock(&g_i2cLock);
+    ret = ioctl(g_i2cFile, I2C_RDWR, packets);
+    pthread_mutex_unlock(&g_i2cLock);
+    if(ret < 0) {
         fprintf(stderr, "ERROR, ioctl returned errno %s\n", strerror(errno));
         fprintf(stderr, "len: %d\n", packets->msgs->len);
         return 1;
@@ -57,6 +57,15 @@
 #define ADI_DSP_PROGRAMMER_I2C_H
 #include <stdint.h>
 
+/*
+ * Largest data payload (bytes) sent in one i2c message by write_i2c_block_data.
+ * On linux user space max message length is 8192 (0x2000) bytes, minus the 2 byte
+ * reg addr and rounded down to a whole dsp word (4 bytes).
+ */
+#define I2C_CHUNK_MAX 8188
+#define I2C_REG_SIZE  2     //number of bytes for a dsp register address
+#define DSP_WORD      4     //bytes, reg addr auto increments once per dsp word
+
 /*
  int i2cOpen(void)
 
@@ -106,6 +115,7 @@ extern int read_i2c_block_data(
  write_i2c_block_data(unsigned char addr, unsigned short reg, unsigned char *data, unsigned short data_size)
 
  * Write data to dsp.
+ * Buffers larger than I2C_CHUNK_MAX are split up into several i2c messages.
  *
  * param addr, the dsp addr in 7 bit notation. 0x74 -> 0x3A
  *
@@ -0,0 +1,186 @@
+#include "i2c_sched.h"
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "i2c.h"
+
+/*
+ * Bus arbitration state, all protected by g_lock
+ *
+ * Each class hands out tickets in order, next_ticket - serving is the number of
+ * requests waiting in that class. A waiter is granted the bus when the bus is
+ * free, its ticket is the next to be served in its class and no higher class
+ * has anyone waiting.
+ */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_cond = PTHREAD_COND_INITIALIZER;
+static int g_busy = 0;
+static unsigned long g_next_ticket[I2C_SCHED_N_CLASSES];
+static unsigned long g_serving[I2C_SCHED_N_CLASSES];
+static i2c_sched_stats_t g_stats[I2C_SCHED_N_CLASSES];
+
+static const char *CLASS_NAMES[I2C_SCHED_N_CLASSES] = {"interactive", "telemetry", "bulk"};
+
+// function prototypes
+static void bus_acquire(i2c_sched_class_t cls);
+static void bus_release(void);
+static int higher_class_waiting(i2c_sched_class_t cls);
+
+int i2c_sched_write(
+        i2c_sched_class_t cls,
+        unsigned char addr,
+        unsigned short reg,
+        const unsigned char *val,
+        unsigned short val_length)
+{
+    unsigned short sent = 0;
+    unsigned short val_length_to_send = 0;
+    int err = 0;
+
+    if (cls >= I2C_SCHED_N_CLASSES) {
+        fprintf(stderr, "ERROR, i2c_sched_write: unknown class %d\n", cls);
+        return 1;
+    }
+
+    // One chunk per bus grant, so that higher classes can get in between chunks
+    while (!err && sent != val_length){
+        val_length_to_send = val_length - sent;
+        if (val_length_to_send > I2C_CHUNK_MAX){
+            val_length_to_send = I2C_CHUNK_MAX;
+        }
+
+        bus_acquire(cls);
+        err = write_i2c_block_data(addr, reg + sent/DSP_WORD, val + sent, val_length_to_send);
+        bus_release();
+
+        sent += val_length_to_send;
+    }
+
+    return err;
+}
+
+int i2c_sched_write_raw(
+        i2c_sched_class_t cls,
+        unsigned char addr,
+        unsigned char *buf,
+        unsigned short buf_size)
+{
+    int err;
+
+    if (cls >= I2C_SCHED_N_CLASSES) {
+        fprintf(stderr, "ERROR, i2c_sched_write_raw: unknown class %d\n", cls);
+        return 1;
+    }
+    if (buf_size > I2C_REG_SIZE + I2C_CHUNK_MAX) {
+        fprintf(stderr, "ERROR, i2c_sched_write_raw: message too large: %d\n", buf_size);
+        return 1;
+    }
+
+    bus_acquire(cls);
+    err = write_i2c_block_data_raw(addr, buf, buf_size);
+    bus_release();
+
+    return err;
+}
+
+int i2c_sched_read(
+        i2c_sched_class_t cls,
+        unsigned char addr,
+        unsigned short reg,
+        unsigned char *val,
+        unsigned short val_length)
+{
+    int err;
+
+    if (cls >= I2C_SCHED_N_CLASSES) {
+        fprintf(stderr, "ERROR, i2c_sched_read: unknown class %d\n", cls);
+        return 1;
+    }
+
+    bus_acquire(cls);
+    err = read_i2c_block_data(addr, reg, val, val_length);
+    bus_release();
+
+    return err;
+}
+
+int i2c_sched_get_stats(i2c_sched_class_t cls, i2c_sched_stats_t *stats){
+    if (cls >= I2C_SCHED_N_CLASSES) {
+        return 1;
+    }
+    pthread_mutex_lock(&g_lock);
+    *stats = g_stats[cls];
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+
+void i2c_sched_print_stats(void){
+    i2c_sched_stats_t stats;
+
+    printf("i2c queueing latency:\n");
+    for (int cls = 0; cls < I2C_SCHED_N_CLASSES; cls++) {
+        i2c_sched_get_stats((i2c_sched_class_t)cls, &stats);
+        printf("  %-11s: grants %llu, mean %.1f us, max %.1f us\n",
+               CLASS_NAMES[cls],
+               (unsigned long long)stats.n_grants,
+               stats.n_grants ? (double)stats.total_wait_ns/stats.n_grants/1000.0 : 0.0,
+               (double)stats.max_wait_ns/1000.0);
+    }
+}
+
+void i2c_sched_reset_stats(void){
+    pthread_mutex_lock(&g_lock);
+    for (int cls = 0; cls < I2C_SCHED_N_CLASSES; cls++) {
+        g_stats[cls].n_grants = 0;
+        g_stats[cls].total_wait_ns = 0;
+        g_stats[cls].max_wait_ns = 0;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+// Block until the calling thread owns the bus, and record how long that took
+static void bus_acquire(i2c_sched_class_t cls){
+    uint64_t start = i2c_sched_now_ns();
+    uint64_t wait;
+    unsigned long ticket;
+
+    pthread_mutex_lock(&g_lock);
+    ticket = g_next_ticket[cls]++;
+    while (g_busy || ticket != g_serving[cls] || higher_class_waiting(cls)) {
+        pthread_cond_wait(&g_cond, &g_lock);
+    }
+    g_serving[cls]++;
+    g_busy = 1;
+
+    wait = i2c_sched_now_ns() - start;
+    g_stats[cls].n_grants++;
+    g_stats[cls].total_wait_ns += wait;
+    if (wait > g_stats[cls].max_wait_ns) {
+        g_stats[cls].max_wait_ns = wait;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void bus_release(void){
+    pthread_mutex_lock(&g_lock);
+    g_busy = 0;
+    // waiters of different classes/tickets share the cond, wake all and let them re-check
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+}
+
+// Must be called with g_lock held
+static int higher_class_waiting(i2c_sched_class_t cls){
+    for (i2c_sched_class_t c = I2C_SCHED_INTERACTIVE; c < cls; c++) {
+        if (g_next_ticket[c] != g_serving[c]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint64_t i2c_sched_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,114 @@
+/*
+ * i2c_sched.h
+ *
+ *  Priority scheduler in front of the i2c dsp functions in i2c.h
+ *
+ *  Several threads in the same process can share the bus, e.g. a meter poller,
+ *  a control path (volume) and a dsp download. Every request is tagged with a
+ *  priority class and the bus is granted to the highest class that is waiting,
+ *  FIFO within a class:
+ *
+ *  I2C_SCHED_INTERACTIVE : user controls, e.g. volume changes
+ *  I2C_SCHED_TELEMETRY   : meter/register polling
+ *  I2C_SCHED_BULK        : program/parameter memory downloads
+ *
+ *  Writes larger than I2C_CHUNK_MAX are split up into chunks and the bus is
+ *  released between the chunks, so a waiting higher class request preempts a
+ *  long download at the next chunk boundary instead of waiting for all of it.
+ *
+ *  The time each request (each chunk for split writes) waits for the bus is
+ *  recorded per class, see i2c_sched_get_stats().
+ *
+ *  i2cOpen() must have been called before any request is made.
+ */
+
+#ifndef ADI_DSP_PROGRAMMER_I2C_SCHED_H
+#define ADI_DSP_PROGRAMMER_I2C_SCHED_H
+#include <stdint.h>
+
+typedef enum {
+    I2C_SCHED_INTERACTIVE = 0,  // highest priority
+    I2C_SCHED_TELEMETRY,
+    I2C_SCHED_BULK,             // lowest priority
+    I2C_SCHED_N_CLASSES
+} i2c_sched_class_t;
+
+/*
+ * Queueing latency for one priority class, i.e. time from a request (chunk)
+ * is submitted until it is granted the bus.
+ */
+typedef struct {
+    uint64_t n_grants;      // number of times the class was granted the bus
+    uint64_t total_wait_ns; // sum of the waiting times
+    uint64_t max_wait_ns;   // worst waiting time
+} i2c_sched_stats_t;
+
+/*
+ * Write data to dsp, see write_i2c_block_data() in i2c.h for the params.
+ * Blocks the calling thread until all data is written.
+ *
+ * param cls, priority class of the request
+ *
+ * return 0 upon success
+ * */
+extern int i2c_sched_write(
+        i2c_sched_class_t cls,
+        unsigned char addr,
+        unsigned short reg,
+        const unsigned char *data,
+        unsigned short data_size);
+
+/*
+ * Write a ready made i2c message to dsp, see write_i2c_block_data_raw() in i2c.h for the params.
+ * buf holds the reg addr (I2C_REG_SIZE bytes) followed by at most I2C_CHUNK_MAX data bytes,
+ * so the caller can fill the data in place without a copy. Sent as one chunk, not split up.
+ * Blocks the calling thread until the message is written.
+ *
+ * param cls, priority class of the request
+ *
+ * return 0 upon success
+ * */
+extern int i2c_sched_write_raw(
+        i2c_sched_class_t cls,
+        unsigned char addr,
+        unsigned char *buf,
+        unsigned short buf_size);
+
+/*
+ * Read data from dsp, see read_i2c_block_data() in i2c.h for the params.
+ * Blocks the calling thread until the data is read.
+ *
+ * param cls, priority class of the request
+ *
+ * return 0 upon success
+ * */
+extern int i2c_sched_read(
+        i2c_sched_class_t cls,
+        unsigned char addr,
+        unsigned short reg,
+        unsigned char *data,
+        unsigned short data_size);
+
+/*
+ * Copy the queueing latency statistics for a class into *stats
+ *
+ * return 0 upon success, 1 if cls is not a valid class
+ */
+extern int i2c_sched_get_stats(i2c_sched_class_t cls, i2c_sched_stats_t *stats);
+
+/*
+ * Print the queueing latency statistics for all classes to stdout
+ */
+extern void i2c_sched_print_stats(void);
+
+/*
+ * Zero the queueing latency statistics for all classes
+ */
+extern void i2c_sched_reset_stats(void);
+
+/*
+ * Monotonic time in ns, used for the latency measurements
+ */
+extern uint64_t i2c_sched_now_ns(void);
+
+#endif //ADI_DSP_PROGRAMMER_I2C_SCHED_H
@@ -3,7 +3,10 @@
 #include <unistd.h>  //usleep
 #include <math.h>
 #include "i2c.h"
+#include "i2c_sched.h"
 #include "download.h"
+#include "dsp_image.h"
+#include "volume.h"
 
 #define ARG_RW       1  // index in the arguments list
 #define ARG_ADDR8    2
@@ -11,6 +14,12 @@
 #define ARG_N_BYTES  4
 #define ARG_VOL      5
 #define ARG_DOWNLOAD 1
+#define ARG_IMAGE    2
+#define BENCH_MIN_NS 500000000ull  // run the bench repeatedly for at least this long
+#define ARG_RAMP_ADDR8    2
+#define ARG_RAMP_VOL      3
+#define ARG_RAMP_DURATION 4
+#define ARG_RAMP_RATE     5
 
 unsigned char rw     = 0;  // read = 0
 unsigned char addr8  = 0;  // 8-bit i2c addr for read
@@ -60,35 +69,6 @@ int convFloatTo824(float dec){
     return t824;
 }
 
-void dec2hex(double x, unsigned char buf[], int buf_sz){
-    unsigned int r, r523;
-    int a = 8, b = 24;
-
-    if (x >= 0) {
-        r = (unsigned int)round(pow(2, b) * x);
-        r523 = (unsigned int)round(pow(2, 23) * x);
-    }else{
-        r = (unsigned int)round(pow(2, a+b) - (pow(2, b) * fabs(x)));
-        r523 = (unsigned int)round(pow(2, 5+23) - (pow(2, 23) * fabs(x)));
-    }
-    buf[0] = r >> 24;
-    buf[1] = r >> 16;
-    buf[2] = r >> 8;
-    buf[3] = r;
-    printf("dec2hex(%f) in 8.24: %i, 0x%08x. In 5.23: %i, 0x%08x\n", (float)x, r, r, r523, r523);
-    //printf("dec2hex: 0x%02x 0x%02x 0x%02x 0x%02x\n", buf[0], buf[1], buf[2], buf[3]);
-}
-
-int gain2bytes(double g, unsigned char buf[]){
-    if(g >= 0 && g <= 1){
-        dec2hex(g, buf, 4);
-        return 0;
-    }else{
-        printf("ERROR. Allowed gain: 0 <= gain <= 1\n");
-        return -1;
-    }
-}
-
 int main(int argc, char *argv[]) {
     // Parse arguments
     // Only 2 arguments = download dsp configuration
@@ -98,6 +78,7 @@ int main(int argc, char *argv[]) {
             i2cOpen();
             usleep(1000000);
             download();
+            i2c_sched_print_stats();
             i2cClose();
         }else{
             printf("ERROR. arg %i: UNKNOWN\n", ARG_DOWNLOAD);
@@ -105,6 +86,74 @@ int main(int argc, char *argv[]) {
         }
         return 0;
     }
+    // 3 args = compressed dsp image, see dsp_image.h
+    if(argc == 3 && (!strcmp(argv[ARG_DOWNLOAD], "pack") || !strcmp(argv[ARG_DOWNLOAD], "load")
+                     || !strcmp(argv[ARG_DOWNLOAD], "bench"))){
+        dsp_image_stats_t stats = {0};
+        int err = 0;
+        printf("arg %i: %s\n", ARG_DOWNLOAD, argv[ARG_DOWNLOAD]);
+        printf("arg %i: %s\n", ARG_IMAGE, argv[ARG_IMAGE]);
+        if(!strcmp(argv[ARG_DOWNLOAD], "pack")){
+            // record the dsp configuration from the system files, nothing is sent to the dsp
+            if(dsp_image_pack_begin(argv[ARG_IMAGE])){
+                return 1;
+            }
+            download();
+            err = dsp_image_pack_end(&stats);
+        }else if(!strcmp(argv[ARG_DOWNLOAD], "load")){
+            i2cOpen();
+            usleep(1000000);
+            err = dsp_image_load(argv[ARG_IMAGE], 0, &stats);
+            i2c_sched_print_stats();
+            i2cClose();
+        }else{
+            // repeat on wall-clock time, an image with only delays has no decoding time
+            unsigned long runs = 0;
+            uint64_t bench_start = i2c_sched_now_ns();
+            do{
+                err = dsp_image_load(argv[ARG_IMAGE], 1, &stats);
+                runs++;
+            }while(!err && stats.raw_bytes && i2c_sched_now_ns() - bench_start < BENCH_MIN_NS);
+            printf("bench: %lu decode runs\n", runs);
+        }
+        if(err){
+            printf("ERROR. %s failed\n", argv[ARG_DOWNLOAD]);
+            return 1;
+        }
+        dsp_image_print_stats(&stats);
+        return 0;
+    }
+    // ramp <i2c-addr> <target-vol> <duration-ms> [rate-hz] = fade from the current vol, see volume.h
+    if((argc == 5 || argc == 6) && !strcmp(argv[ARG_DOWNLOAD], "ramp")){
+        volume_ramp_stats_t stats;
+        float vol = 0.0, start = 0.0;
+        unsigned int ramp_addr8 = 0, duration_ms = 0, rate_hz = VOL_RAMP_RATE_HZ;
+        int err = 0;
+        sscanf(argv[ARG_RAMP_ADDR8], "%x", &ramp_addr8);
+        printf("arg %i: 0x%02x\n", ARG_RAMP_ADDR8, ramp_addr8);
+        sscanf(argv[ARG_RAMP_VOL], "%f", &vol);
+        printf("arg %i: %f\n", ARG_RAMP_VOL, vol);
+        sscanf(argv[ARG_RAMP_DURATION], "%u", &duration_ms);
+        printf("arg %i: %u ms\n", ARG_RAMP_DURATION, duration_ms);
+        if(argc == 6){
+            sscanf(argv[ARG_RAMP_RATE], "%u", &rate_hz);
+        }
+        printf("rate: %u Hz\n", rate_hz);
+        i2cOpen();
+        addr8 = (unsigned char)(ramp_addr8>>1);
+        if(volume_get(addr8, &start)){
+            printf("Failed to read gain\n");
+            i2cClose();
+            return 1;
+        }
+        printf("ramp: %f -> %f\n", start, vol);
+        err = volume_ramp(addr8, start, vol, duration_ms, rate_hz, &stats);
+        if(!err){
+            volume_ramp_print_stats(&stats);
+        }
+        i2cClose();
+        return err;
+    }
     // More than 2 args = read/write I/O to individual regs
     if(argc > 2){
         //RW
@@ -128,23 +177,18 @@ int main(int argc, char *argv[]) {
 
         // temp for gain adjustment
         if(argc == 6){
-#define BUF_BYTES       4
-#define ALPHA_REG_BYTES 8
             int err = 0;
             float vol = 0.0, g = 0.0;
-            unsigned short gain_reg = 1242;
-            printf("using fixed gain adj reg: 0x%04x\n", gain_reg);
-            unsigned short alpha_reg = 1243;
-            unsigned char alpha_reg_data[ALPHA_REG_BYTES] = {0x00, 0xff, 0xfb, 0xd5, 0x00, 0x00, 0x04, 0x2b};
+            printf("using fixed gain adj reg: 0x%04x\n", VOL_GAIN_REG);
             sscanf(argv[ARG_VOL], "%f", &vol);
             if(vol < 0 || vol > 100){
                 printf("ERROR. vol: 0 <= vol <= 100\n");
                 return -1;
             }
             printf("arg %i: %f\n", ARG_VOL, vol);
-            g = pow(10,(vol-100.0)/20.0);
+            g = vol2gain(vol);
             printf("vol2gain(%f): %f\n", vol, g);
-            unsigned char buf[BUF_BYTES];
+            unsigned char buf[VOL_GAIN_BYTES];
             if(gain2bytes(g, buf)){
                 printf("ERROR\n");
                 return -1;
@@ -154,16 +198,9 @@ int main(int argc, char *argv[]) {
             //return 0;
             i2cOpen();
             addr8 = addr8>>1;
-            err = write_i2c_block_data(addr8, gain_reg, buf, BUF_BYTES);
-            if(err){
-                printf("Failed to set gain\n");
-            }
-            err = write_i2c_block_data(addr8, alpha_reg, alpha_reg_data, ALPHA_REG_BYTES);
-            if(err){
-                printf("Failed to set alpha\n");
-            }
+            err = volume_set(addr8, vol);
             i2cClose();
-            return 0;
+            return err;
         }
     }
 
@@ -171,7 +208,7 @@ int main(int argc, char *argv[]) {
     unsigned char inbuf[n_bytes];
     i2cOpen();
     addr8 = (addr8>>1);
-    int err = read_i2c_block_data(addr8, reg, inbuf, n_bytes);
+    int err = i2c_sched_read(I2C_SCHED_TELEMETRY, addr8, reg, inbuf, n_bytes);
     if(err){
         printf("Failed to read\n");
     }
@@ -4,7 +4,8 @@
 
 #include "SigmaStudioFW.h"
 #include <unistd.h>
-#include "../i2c.h"
+#include "../i2c_sched.h"
+#include "../dsp_image.h"
 #include <stdio.h>
 
 void SIGMA_READ_REGISTER( int devAddress, int address, int length, ADI_REG_TYPE *pData ){
@@ -13,10 +14,18 @@ void SIGMA_READ_REGISTER( int devAddress, int address, int length, ADI_REG_TYPE
 
 void SIGMA_WRITE_REGISTER_BLOCK( int devAddress8, int address, int length, ADI_REG_TYPE *pData ){
     //printf("In SIGMA_WRITE_REGISTER_BLOCK\n");
-    write_i2c_block_data(devAddress8>>1, address, pData, length);
+    if(dsp_image_is_packing()){
+        dsp_image_pack_block(devAddress8, address, length, pData);
+        return;
+    }
+    i2c_sched_write(I2C_SCHED_BULK, devAddress8>>1, address, pData, length);
 }
 
 void SIGMA_WRITE_DELAY( int devAddress, int length, ADI_REG_TYPE *pData ){
+    if(dsp_image_is_packing()){
+        dsp_image_pack_delay(devAddress, length, pData);
+        return;
+    }
     if(pData[1] == 0xFF){
         usleep(11000);
     }else if(pData[1] == 0x01){
@@ -0,0 +1,295 @@
+/*
+ * dsp_image_test.c
+ *
+ *  pack -> load round trip of dsp_image.c against a stubbed i2c bus
+ *
+ *  - the data and reg addr of every message sent to the bus must match what was packed,
+ *    with the fixture picking every codec (raw, rle and lz) at least once
+ *  - images with flipped bits or truncated must be rejected before anything is sent
+ *  - an image with only delays must load, delays shorter than 2 bytes are not packed
+ *  - a bus error stops the load at the failing block
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "../i2c.h"
+#include "../i2c_sched.h"
+#include "../dsp_image.h"
+#include "../system_files/SigmaStudioFW.h"
+
+#define IMAGE_PATH   "dsp_image_test.img"
+#define CORRUPT_PATH "dsp_image_test_corrupt.img"
+#define BLOCK_A_LEN  30000
+#define BLOCK_A_REG  0xC000
+#define BLOCK_B_REG  0xF400
+#define BLOCK_C_LEN  4000
+#define BLOCK_C_REG  0x2000
+#define DEV_ADDR8    0x70
+#define MAX_MSGS     16
+#define N_CORRUPT    2000
+
+static unsigned char g_block_a[BLOCK_A_LEN];
+static unsigned char g_block_b[6] = {0x00, 0x01, 0x00, 0x00, 0x12, 0x34};
+static unsigned char g_block_c[BLOCK_C_LEN];
+static unsigned char g_delay[2] = {0x00, 0x01};  // shortest SIGMA_WRITE_DELAY
+
+// everything sent to the stubbed bus
+static unsigned char g_sent[BLOCK_A_LEN + sizeof(g_block_b) + BLOCK_C_LEN];
+static long g_sent_len;
+static unsigned short g_msg_regs[MAX_MSGS];
+static int g_n_msgs;
+static int g_bad_msg;
+static int g_fail_bus;   // make every write fail
+static int g_n_failed;   // writes that failed because of g_fail_bus
+static uint32_t g_rand = 12345;
+
+int write_i2c_block_data_raw(unsigned char addr, unsigned char *buf, unsigned short buf_size){
+    int len = buf_size - I2C_REG_SIZE;
+
+    if (g_fail_bus) {
+        g_n_failed++;
+        return 1;
+    }
+    if (addr != DEV_ADDR8>>1 || len < 0 || g_sent_len + len > (long)sizeof(g_sent) || g_n_msgs == MAX_MSGS) {
+        g_bad_msg = 1;
+        return 1;
+    }
+    g_msg_regs[g_n_msgs++] = (unsigned short)(buf[0] << 8 | buf[1]);
+    memcpy(&g_sent[g_sent_len], &buf[I2C_REG_SIZE], len);
+    g_sent_len += len;
+    return 0;
+}
+
+int write_i2c_block_data(unsigned char addr, unsigned short reg, const unsigned char *data, unsigned short data_size){
+    (void)addr; (void)reg; (void)data; (void)data_size;
+    g_bad_msg = 1;  // the loader must only use the raw path
+    return 1;
+}
+
+int read_i2c_block_data(unsigned char addr, unsigned short reg, unsigned char *data, unsigned short data_size){
+    (void)addr; (void)reg; (void)data; (void)data_size;
+    return 1;
+}
+
+static uint32_t next_rand(void){
+    g_rand = g_rand*1103515245u + 12345u;
+    return g_rand >> 8;
+}
+
+static void reset_bus(void){
+    g_sent_len = 0;
+    g_n_msgs = 0;
+    g_bad_msg = 0;
+    g_fail_bus = 0;
+    g_n_failed = 0;
+}
+
+static long read_file(const char *path, unsigned char *buf, long cap){
+    FILE *f = fopen(path, "rb");
+    long n;
+
+    if (f == NULL) {
+        return -1;
+    }
+    n = (long)fread(buf, 1, cap, f);
+    fclose(f);
+    return n;
+}
+
+static int write_file(const char *path, const unsigned char *buf, long len){
+    FILE *f = fopen(path, "wb");
+
+    if (f == NULL) {
+        return 1;
+    }
+    fwrite(buf, 1, len, f);
+    return fclose(f) != 0;
+}
+
+static int test_round_trip(void){
+    dsp_image_stats_t packed = {0}, loaded = {0};
+    int a_msgs = (BLOCK_A_LEN + I2C_CHUNK_MAX - 1)/I2C_CHUNK_MAX;
+    int expected_msgs = a_msgs + 2;
+
+    // zero filled, repetitive and random memory
+    for (int i = 0; i < BLOCK_A_LEN; i++) {
+        switch ((i/4096) % 3) {
+            case 0:  g_block_a[i] = 0; break;
+            case 1:  g_block_a[i] = (unsigned char)(0x12 + (i % 16)*(i % 7 == 0)); break;
+            default: g_block_a[i] = (unsigned char)next_rand(); break;
+        }
+    }
+    // short zero runs between random bytes, where rle beats lz
+    for (int i = 0; i < BLOCK_C_LEN; i++) {
+        g_block_c[i] = (i % 8 < 5) ? 0 : (unsigned char)(next_rand() | 1);
+    }
+
+    if (dsp_image_pack_begin(IMAGE_PATH)) {
+        printf("FAIL: pack_begin\n");
+        return 1;
+    }
+    SIGMA_WRITE_REGISTER_BLOCK(DEV_ADDR8, BLOCK_A_REG, BLOCK_A_LEN, g_block_a);
+    SIGMA_WRITE_DELAY(DEV_ADDR8, sizeof(g_delay), g_delay);
+    SIGMA_WRITE_REGISTER_BLOCK(DEV_ADDR8, BLOCK_B_REG, sizeof(g_block_b), g_block_b);
+    SIGMA_WRITE_REGISTER_BLOCK(DEV_ADDR8, BLOCK_C_REG, BLOCK_C_LEN, g_block_c);
+    if (dsp_image_pack_end(&packed) || dsp_image_is_packing()) {
+        printf("FAIL: pack_end\n");
+        return 1;
+    }
+    if (!packed.n_blocks[DSP_IMAGE_CODEC_RAW] || !packed.n_blocks[DSP_IMAGE_CODEC_RLE]
+        || !packed.n_blocks[DSP_IMAGE_CODEC_LZ]) {
+        printf("FAIL: codecs used raw %llu, rle %llu, lz %llu, expected all\n",
+               (unsigned long long)packed.n_blocks[DSP_IMAGE_CODEC_RAW],
+               (unsigned long long)packed.n_blocks[DSP_IMAGE_CODEC_RLE],
+               (unsigned long long)packed.n_blocks[DSP_IMAGE_CODEC_LZ]);
+        return 1;
+    }
+
+    reset_bus();
+    if (dsp_image_load(IMAGE_PATH, 0, &loaded) || g_bad_msg) {
+        printf("FAIL: load\n");
+        return 1;
+    }
+    if (g_sent_len != BLOCK_A_LEN + (long)sizeof(g_block_b) + BLOCK_C_LEN
+        || memcmp(g_sent, g_block_a, BLOCK_A_LEN)
+        || memcmp(&g_sent[BLOCK_A_LEN], g_block_b, sizeof(g_block_b))
+        || memcmp(&g_sent[BLOCK_A_LEN + sizeof(g_block_b)], g_block_c, BLOCK_C_LEN)) {
+        printf("FAIL: loaded data differs from packed data\n");
+        return 1;
+    }
+    if (g_n_msgs != expected_msgs) {
+        printf("FAIL: %d messages, expected %d\n", g_n_msgs, expected_msgs);
+        return 1;
+    }
+    for (int m = 0; m < a_msgs; m++) {
+        if (g_msg_regs[m] != BLOCK_A_REG + m*I2C_CHUNK_MAX/DSP_WORD) {
+            printf("FAIL: message %d reg 0x%04x\n", m, g_msg_regs[m]);
+            return 1;
+        }
+    }
+    if (g_msg_regs[a_msgs] != BLOCK_B_REG || g_msg_regs[a_msgs + 1] != BLOCK_C_REG) {
+        printf("FAIL: last message regs 0x%04x 0x%04x\n", g_msg_regs[a_msgs], g_msg_regs[a_msgs + 1]);
+        return 1;
+    }
+    if (loaded.raw_bytes != packed.raw_bytes || loaded.image_bytes != packed.image_bytes
+        || packed.image_bytes >= packed.raw_bytes) {
+        printf("FAIL: stats, raw %llu/%llu, image %llu/%llu\n",
+               (unsigned long long)packed.raw_bytes, (unsigned long long)loaded.raw_bytes,
+               (unsigned long long)packed.image_bytes, (unsigned long long)loaded.image_bytes);
+        return 1;
+    }
+    dsp_image_print_stats(&loaded);
+    return 0;
+}
+
+static int test_corrupt(void){
+    static unsigned char image[2*BLOCK_A_LEN];
+    static unsigned char corrupt[2*BLOCK_A_LEN];
+    long len = read_file(IMAGE_PATH, image, sizeof(image));
+    int n_flips, bit;
+
+    if (len <= 0 || len == (long)sizeof(image)) {
+        printf("FAIL: read %s\n", IMAGE_PATH);
+        return 1;
+    }
+
+    for (int i = 0; i < N_CORRUPT; i++) {
+        memcpy(corrupt, image, len);
+        n_flips = 1 + (int)(next_rand() % 4);
+        for (int k = 0; k < n_flips; k++) {
+            bit = (int)(next_rand() % (uint32_t)(len*8));
+            corrupt[bit/8] ^= (unsigned char)(1 << (bit % 8));
+        }
+        if (!memcmp(corrupt, image, len)) {
+            continue;  // flips cancelled out
+        }
+        reset_bus();
+        if (write_file(CORRUPT_PATH, corrupt, len)) {
+            printf("FAIL: write %s\n", CORRUPT_PATH);
+            return 1;
+        }
+        if (!dsp_image_load(CORRUPT_PATH, 0, NULL) || g_n_msgs) {
+            printf("FAIL: corrupt image %d accepted or partly sent (%d messages)\n", i, g_n_msgs);
+            return 1;
+        }
+    }
+
+    // truncated anywhere
+    for (long cut = 0; cut < len; cut += 97) {
+        reset_bus();
+        if (write_file(CORRUPT_PATH, image, cut)) {
+            return 1;
+        }
+        if (!dsp_image_load(CORRUPT_PATH, 0, NULL) || g_n_msgs) {
+            printf("FAIL: image truncated to %ld bytes accepted\n", cut);
+            return 1;
+        }
+    }
+    remove(CORRUPT_PATH);
+    return 0;
+}
+
+static int test_delays_only(void){
+    dsp_image_stats_t stats = {0};
+
+    if (dsp_image_pack_begin(IMAGE_PATH)) {
+        return 1;
+    }
+    SIGMA_WRITE_DELAY(DEV_ADDR8, sizeof(g_delay), g_delay);
+    if (dsp_image_pack_end(NULL)) {
+        return 1;
+    }
+    reset_bus();
+    if (dsp_image_load(IMAGE_PATH, 0, &stats) || g_n_msgs || stats.raw_bytes) {
+        printf("FAIL: delays only image\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_short_delay(void){
+    if (dsp_image_pack_begin(IMAGE_PATH)) {
+        return 1;
+    }
+    if (!dsp_image_pack_delay(DEV_ADDR8, 1, g_delay) || !dsp_image_pack_end(NULL)) {
+        printf("FAIL: 1 byte delay packed\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_bus_error(void){
+    if (dsp_image_pack_begin(IMAGE_PATH)) {
+        return 1;
+    }
+    SIGMA_WRITE_REGISTER_BLOCK(DEV_ADDR8, BLOCK_B_REG, sizeof(g_block_b), g_block_b);
+    SIGMA_WRITE_REGISTER_BLOCK(DEV_ADDR8, BLOCK_C_REG, BLOCK_C_LEN, g_block_c);
+    if (dsp_image_pack_end(NULL)) {
+        return 1;
+    }
+    reset_bus();
+    g_fail_bus = 1;
+    if (!dsp_image_load(IMAGE_PATH, 0, NULL) || g_n_failed != 1) {
+        printf("FAIL: bus error, %d writes failed, expected load to stop after 1\n", g_n_failed);
+        return 1;
+    }
+    return 0;
+}
+
+static int test_pack_begin_fails(void){
+    if (!dsp_image_pack_begin("no_such_dir/dsp_image_test.img") || dsp_image_is_packing()) {
+        printf("FAIL: pack_begin to a missing dir\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(void){
+    int err = test_round_trip() || test_corrupt() || test_delays_only() || test_short_delay()
+              || test_bus_error() || test_pack_begin_fails();
+
+    remove(IMAGE_PATH);
+    printf("%s\n", err ? "dsp_image_test: FAILED" : "dsp_image_test: OK");
+    return err;
+}
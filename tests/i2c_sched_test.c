@@ -0,0 +1,169 @@
+/*
+ * i2c_sched_test.c
+ *
+ *  Priority and preemption of i2c_sched.c against a stubbed, slow i2c bus
+ *
+ *  A bulk write of several chunks is started. While its first chunk is on the bus a
+ *  telemetry read and then an interactive write arrive. Expected bus order:
+ *  bulk chunk 0, interactive, telemetry, the rest of the bulk chunks.
+ *  I.e. interactive before telemetry before bulk, and both get the bus at the next
+ *  chunk boundary of the bulk write, not after all of it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>  //usleep
+#include <pthread.h>
+#include "../i2c.h"
+#include "../i2c_sched.h"
+
+#define DEV_ADDR      0x3A
+#define BULK_REG      0x0000
+#define CTRL_REG      1242
+#define BULK_LEN      40000
+#define BULK_CHUNKS   ((BULK_LEN + I2C_CHUNK_MAX - 1)/I2C_CHUNK_MAX)
+#define CHUNK_US      100000  // time on the bus per bulk chunk
+#define SHORT_US      10000   // time on the bus per interactive/telemetry request
+#define MAX_LOG       16
+
+static unsigned char g_bulk[BULK_LEN];
+
+// bus log, one char per message: B(ulk), I(nteractive), T(elemetry)
+static pthread_mutex_t g_log_lock = PTHREAD_MUTEX_INITIALIZER;
+static char g_log[MAX_LOG + 1];
+static unsigned short g_bulk_regs[MAX_LOG];
+static int g_n_log;
+static int g_n_bulk;
+
+static void log_msg(char c, unsigned short reg){
+    pthread_mutex_lock(&g_log_lock);
+    if (g_n_log < MAX_LOG) {
+        g_log[g_n_log++] = c;
+        if (c == 'B') {
+            g_bulk_regs[g_n_bulk++] = reg;
+        }
+    }
+    pthread_mutex_unlock(&g_log_lock);
+}
+
+static int bulk_started(void){
+    int started;
+
+    pthread_mutex_lock(&g_log_lock);
+    started = g_n_bulk > 0;
+    pthread_mutex_unlock(&g_log_lock);
+    return started;
+}
+
+int write_i2c_block_data(unsigned char addr, unsigned short reg, const unsigned char *data, unsigned short data_size){
+    (void)addr; (void)data; (void)data_size;
+    if (reg == CTRL_REG) {
+        log_msg('I', reg);
+        usleep(SHORT_US);
+    } else {
+        log_msg('B', reg);
+        usleep(CHUNK_US);
+    }
+    return 0;
+}
+
+int write_i2c_block_data_raw(unsigned char addr, unsigned char *buf, unsigned short buf_size){
+    (void)addr; (void)buf; (void)buf_size;
+    return 1;  // not used here
+}
+
+int read_i2c_block_data(unsigned char addr, unsigned short reg, unsigned char *data, unsigned short data_size){
+    (void)addr;
+    log_msg('T', reg);
+    memset(data, 0, data_size);
+    usleep(SHORT_US);
+    return 0;
+}
+
+static void *bulk_thread(void *arg){
+    (void)arg;
+    return (void *)(intptr_t)i2c_sched_write(I2C_SCHED_BULK, DEV_ADDR, BULK_REG, g_bulk, BULK_LEN);
+}
+
+static void *telemetry_thread(void *arg){
+    unsigned char buf[4];
+    (void)arg;
+    return (void *)(intptr_t)i2c_sched_read(I2C_SCHED_TELEMETRY, DEV_ADDR, 0xF400, buf, sizeof(buf));
+}
+
+static void *interactive_thread(void *arg){
+    unsigned char buf[4] = {0x00, 0x80, 0x00, 0x00};
+    (void)arg;
+    return (void *)(intptr_t)i2c_sched_write(I2C_SCHED_INTERACTIVE, DEV_ADDR, CTRL_REG, buf, sizeof(buf));
+}
+
+int main(void){
+    pthread_t bulk, telemetry, interactive;
+    void *ret_bulk, *ret_telemetry, *ret_interactive;
+    i2c_sched_stats_t stats[I2C_SCHED_N_CLASSES];
+    char expected[MAX_LOG + 1];
+    int err = 0;
+
+    i2c_sched_reset_stats();
+    pthread_create(&bulk, NULL, bulk_thread, NULL);
+    while (!bulk_started()) {
+        usleep(1000);
+    }
+    // both arrive while bulk chunk 0 is on the bus, telemetry first
+    pthread_create(&telemetry, NULL, telemetry_thread, NULL);
+    usleep(CHUNK_US/5);
+    pthread_create(&interactive, NULL, interactive_thread, NULL);
+
+    pthread_join(bulk, &ret_bulk);
+    pthread_join(telemetry, &ret_telemetry);
+    pthread_join(interactive, &ret_interactive);
+    if (ret_bulk || ret_telemetry || ret_interactive) {
+        printf("FAIL: a request returned an error\n");
+        err = 1;
+    }
+
+    // bus order
+    memset(expected, 'B', BULK_CHUNKS + 2);
+    expected[1] = 'I';
+    expected[2] = 'T';
+    expected[BULK_CHUNKS + 2] = '\0';
+    if (strcmp(g_log, expected)) {
+        printf("FAIL: bus order %s, expected %s\n", g_log, expected);
+        err = 1;
+    }
+    for (int c = 0; c < g_n_bulk; c++) {
+        if (g_bulk_regs[c] != BULK_REG + c*I2C_CHUNK_MAX/DSP_WORD) {
+            printf("FAIL: bulk chunk %d reg 0x%04x\n", c, g_bulk_regs[c]);
+            err = 1;
+        }
+    }
+
+    for (int cls = 0; cls < I2C_SCHED_N_CLASSES; cls++) {
+        i2c_sched_get_stats((i2c_sched_class_t)cls, &stats[cls]);
+    }
+    i2c_sched_print_stats();
+    if (stats[I2C_SCHED_INTERACTIVE].n_grants != 1 || stats[I2C_SCHED_TELEMETRY].n_grants != 1
+        || stats[I2C_SCHED_BULK].n_grants != BULK_CHUNKS) {
+        printf("FAIL: grants %llu/%llu/%llu, expected 1/1/%d\n",
+               (unsigned long long)stats[I2C_SCHED_INTERACTIVE].n_grants,
+               (unsigned long long)stats[I2C_SCHED_TELEMETRY].n_grants,
+               (unsigned long long)stats[I2C_SCHED_BULK].n_grants, BULK_CHUNKS);
+        err = 1;
+    }
+    // interactive waits for the rest of bulk chunk 0 only, telemetry also for interactive,
+    // bulk chunk 1 waits for both
+    if (stats[I2C_SCHED_INTERACTIVE].max_wait_ns == 0
+        || stats[I2C_SCHED_INTERACTIVE].max_wait_ns >= CHUNK_US*1000ull
+        || stats[I2C_SCHED_TELEMETRY].max_wait_ns <= stats[I2C_SCHED_INTERACTIVE].max_wait_ns
+        || stats[I2C_SCHED_BULK].max_wait_ns < 2*SHORT_US*1000ull) {
+        printf("FAIL: max wait %llu/%llu/%llu ns\n",
+               (unsigned long long)stats[I2C_SCHED_INTERACTIVE].max_wait_ns,
+               (unsigned long long)stats[I2C_SCHED_TELEMETRY].max_wait_ns,
+               (unsigned long long)stats[I2C_SCHED_BULK].max_wait_ns);
+        err = 1;
+    }
+
+    printf("%s\n", err ? "i2c_sched_test: FAILED" : "i2c_sched_test: OK");
+    return err;
+}
@@ -0,0 +1,117 @@
+/*
+ * volume_ramp_test.c
+ *
+ *  volume_ramp() of volume.c against a stubbed i2c bus that can stall
+ *
+ *  - the last gain written is the target, alpha is written once per ramp
+ *  - every step of the trajectory is either written or counted as missed
+ *  - a stall on the bus shows up in full in the max jitter, and as missed periods
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>  //usleep
+#include "../i2c.h"
+#include "../volume.h"
+
+#define DEV_ADDR     0x3A
+#define RATE_HZ      200
+#define DURATION_MS  500
+#define N_STEPS      (DURATION_MS*RATE_HZ/1000)
+#define PERIOD_US    (1000000/RATE_HZ)
+#define STALL_WRITE  20      // the gain write that stalls
+#define STALL_US     35000
+
+static unsigned char g_last_gain[VOL_GAIN_BYTES];
+static int g_n_gain;
+static int g_n_alpha;
+static int g_stall;
+
+int write_i2c_block_data(unsigned char addr, unsigned short reg, const unsigned char *data, unsigned short data_size){
+    if (addr != DEV_ADDR) {
+        return 1;
+    }
+    if (reg == VOL_ALPHA_REG) {
+        g_n_alpha++;
+        return 0;
+    }
+    if (reg != VOL_GAIN_REG || data_size != VOL_GAIN_BYTES) {
+        return 1;
+    }
+    memcpy(g_last_gain, data, VOL_GAIN_BYTES);
+    if (++g_n_gain == STALL_WRITE && g_stall) {
+        usleep(STALL_US);
+    }
+    return 0;
+}
+
+int write_i2c_block_data_raw(unsigned char addr, unsigned char *buf, unsigned short buf_size){
+    (void)addr; (void)buf; (void)buf_size;
+    return 1;
+}
+
+int read_i2c_block_data(unsigned char addr, unsigned short reg, unsigned char *data, unsigned short data_size){
+    (void)addr; (void)reg; (void)data; (void)data_size;
+    return 1;
+}
+
+static int run_ramp(const char *name, float start, float target, unsigned int duration_ms,
+                    int stall, unsigned int expected_steps, volume_ramp_stats_t *stats){
+    unsigned char expected[VOL_GAIN_BYTES];
+
+    g_n_gain = 0;
+    g_n_alpha = 0;
+    g_stall = stall;
+    if (volume_ramp(DEV_ADDR, start, target, duration_ms, RATE_HZ, stats)) {
+        printf("FAIL: %s: volume_ramp returned an error\n", name);
+        return 1;
+    }
+    printf("%s:\n", name);
+    volume_ramp_print_stats(stats);
+
+    gain2bytes(vol2gain(target), expected);
+    if (memcmp(g_last_gain, expected, VOL_GAIN_BYTES)) {
+        printf("FAIL: %s: last gain %f, expected %f\n", name, bytes2gain(g_last_gain), vol2gain(target));
+        return 1;
+    }
+    if (g_n_alpha != 1 || g_n_gain != (int)stats->n_updates) {
+        printf("FAIL: %s: %d alpha writes, %d gain writes for %u updates\n",
+               name, g_n_alpha, g_n_gain, stats->n_updates);
+        return 1;
+    }
+    if (stats->n_updates + stats->n_missed != expected_steps) {
+        printf("FAIL: %s: %u updates + %u missed, expected %u steps\n",
+               name, stats->n_updates, stats->n_missed, expected_steps);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void){
+    volume_ramp_stats_t stats;
+    int err = 0;
+
+    // fade down and up
+    err |= run_ramp("ramp down", 80, 40, DURATION_MS, 0, N_STEPS, &stats);
+    err |= run_ramp("ramp up", 40, 80, DURATION_MS, 0, N_STEPS, &stats);
+
+    // shorter than one period, a single update to the target
+    err |= run_ramp("no ramp", 40, 60, 0, 0, 1, &stats);
+    if (!err && stats.n_updates != 1) {
+        printf("FAIL: no ramp: %u updates\n", stats.n_updates);
+        err = 1;
+    }
+
+    // the update after the stall is late by the stall minus at most one period
+    err |= run_ramp("stalled", 100, 50, DURATION_MS, 1, N_STEPS, &stats);
+    if (!err && (stats.jitter_max_us < STALL_US - PERIOD_US - PERIOD_US/2
+                 || stats.n_missed < STALL_US/PERIOD_US - 2
+                 || stats.write_max_us < STALL_US)) {
+        printf("FAIL: stalled: max jitter %.1f us, %u missed, max write %.1f us\n",
+               stats.jitter_max_us, stats.n_missed, stats.write_max_us);
+        err = 1;
+    }
+
+    printf("%s\n", err ? "volume_ramp_test: FAILED" : "volume_ramp_test: OK");
+    return err;
+}
@@ -0,0 +1,225 @@
+#include "volume.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>  //strerror
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>  //read, close
+#include <sys/timerfd.h>
+#include "i2c_sched.h"
+
+#define ALPHA_REG_BYTES 8
+#define NS_PER_SEC      1000000000ull
+
+static const unsigned char ALPHA_REG_DATA[ALPHA_REG_BYTES] = {0x00, 0xff, 0xfb, 0xd5, 0x00, 0x00, 0x04, 0x2b};
+
+// function prototypes
+static void dec2hex(double x, unsigned char buf[]);
+static int write_gain(unsigned char addr, float vol);
+static int write_alpha(unsigned char addr);
+static void ns2timespec(uint64_t ns, struct timespec *ts);
+
+double vol2gain(float vol){
+    return pow(10, (vol-100.0)/20.0);
+}
+
+float gain2vol(double g){
+    float vol;
+
+    if (g <= 0) {
+        return 0;
+    }
+    vol = (float)(100.0 + 20.0*log10(g));
+    if (vol < 0) {
+        vol = 0;
+    } else if (vol > 100) {
+        vol = 100;
+    }
+    return vol;
+}
+
+int gain2bytes(double g, unsigned char buf[]){
+    if(g >= 0 && g <= 1){
+        dec2hex(g, buf);
+        return 0;
+    }else{
+        printf("ERROR. Allowed gain: 0 <= gain <= 1\n");
+        return -1;
+    }
+}
+
+double bytes2gain(const unsigned char buf[]){
+    int32_t r = (int32_t)((uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 | (uint32_t)buf[2] << 8 | buf[3]);
+    return (double)r/(double)(1<<24);
+}
+
+int volume_set(unsigned char addr, float vol){
+    if (write_gain(addr, vol)) {
+        printf("Failed to set gain\n");
+        return 1;
+    }
+    if (write_alpha(addr)) {
+        printf("Failed to set alpha\n");
+        return 1;
+    }
+    return 0;
+}
+
+int volume_get(unsigned char addr, float *vol){
+    unsigned char buf[VOL_GAIN_BYTES];
+
+    if (i2c_sched_read(I2C_SCHED_INTERACTIVE, addr, VOL_GAIN_REG, buf, VOL_GAIN_BYTES)) {
+        return 1;
+    }
+    *vol = gain2vol(bytes2gain(buf));
+    return 0;
+}
+
+int volume_ramp(
+        unsigned char addr,
+        float start,
+        float target,
+        unsigned int duration_ms,
+        unsigned int rate_hz,
+        volume_ramp_stats_t *stats)
+{
+    volume_ramp_stats_t s = {0};
+    struct itimerspec its;
+    uint64_t period_ns, t0, t_wake, t_write, late, wrote, expirations;
+    uint64_t tick = 0;
+    unsigned int n_steps, step = 0;
+    double jitter_sum = 0, jitter_sq_sum = 0, write_sum = 0;
+    int fd;
+    int isError = 0;
+
+    if (start < 0 || start > 100 || target < 0 || target > 100) {
+        printf("ERROR. vol: 0 <= vol <= 100\n");
+        return 1;
+    }
+    if (rate_hz < 1 || rate_hz > VOL_RAMP_RATE_MAX) {
+        printf("ERROR. rate: 1 <= rate <= %d\n", VOL_RAMP_RATE_MAX);
+        return 1;
+    }
+
+    n_steps = (unsigned int)((uint64_t)duration_ms*rate_hz/1000);
+    if (n_steps == 0) {
+        n_steps = 1;
+    }
+    period_ns = NS_PER_SEC/rate_hz;
+
+    // alpha is constant, one write is enough, then only the gain is updated
+    if (write_alpha(addr)) {
+        printf("Failed to set alpha\n");
+        return 1;
+    }
+
+    fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (fd < 0) {
+        perror("timerfd_create");
+        return 1;
+    }
+    // absolute expiry times, update k is due at t0 + k*period whatever the earlier updates took
+    t0 = i2c_sched_now_ns();
+    ns2timespec(t0 + period_ns, &its.it_value);
+    ns2timespec(period_ns, &its.it_interval);
+    if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("timerfd_settime");
+        close(fd);
+        return 1;
+    }
+
+    while (!isError && step < n_steps) {
+        if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR, timerfd read: %s\n", strerror(errno));
+            isError = 1;
+            break;
+        }
+        t_wake = i2c_sched_now_ns();
+
+        // lateness of the first slot that was due since the last update, i.e. of the update that
+        // was delayed. After an overrun this is the whole delay, not just the part after the latest slot.
+        late = t_wake - (t0 + (tick + 1)*period_ns);
+
+        // more than 1 expiration = we were late, skip ahead on the trajectory to stay on time
+        tick += expirations;
+        s.n_missed += (unsigned int)(expirations - 1);
+        step += (unsigned int)expirations;
+        if (step > n_steps) {
+            step = n_steps;
+        }
+
+        jitter_sum += (double)late;
+        jitter_sq_sum += (double)late*(double)late;
+        if (late/1000.0 > s.jitter_max_us) {
+            s.jitter_max_us = late/1000.0;
+        }
+
+        t_write = i2c_sched_now_ns();
+        if (write_gain(addr, start + (target - start)*(float)step/(float)n_steps)) {
+            printf("Failed to set gain\n");
+            isError = 1;
+        }
+        wrote = i2c_sched_now_ns() - t_write;
+        write_sum += (double)wrote;
+        if (wrote/1000.0 > s.write_max_us) {
+            s.write_max_us = wrote/1000.0;
+        }
+        s.n_updates++;
+    }
+    close(fd);
+
+    if (s.n_updates) {
+        s.jitter_mean_us = jitter_sum/s.n_updates/1000.0;
+        s.jitter_std_us = sqrt(fmax(0, jitter_sq_sum/s.n_updates - pow(jitter_sum/s.n_updates, 2)))/1000.0;
+        s.write_mean_us = write_sum/s.n_updates/1000.0;
+    }
+    if (stats) {
+        *stats = s;
+    }
+    return isError;
+}
+
+void volume_ramp_print_stats(const volume_ramp_stats_t *stats){
+    printf("volume ramp: %u updates, %u missed periods\n", stats->n_updates, stats->n_missed);
+    printf("  jitter: mean %.1f us, std %.1f us, max %.1f us\n",
+           stats->jitter_mean_us, stats->jitter_std_us, stats->jitter_max_us);
+    printf("  write : mean %.1f us, max %.1f us\n", stats->write_mean_us, stats->write_max_us);
+}
+
+// gain in 8.24
+static void dec2hex(double x, unsigned char buf[]){
+    unsigned int r;
+    int a = 8, b = 24;
+
+    if (x >= 0) {
+        r = (unsigned int)round(pow(2, b) * x);
+    }else{
+        r = (unsigned int)round(pow(2, a+b) - (pow(2, b) * fabs(x)));
+    }
+    buf[0] = r >> 24;
+    buf[1] = r >> 16;
+    buf[2] = r >> 8;
+    buf[3] = r;
+}
+
+static int write_gain(unsigned char addr, float vol){
+    unsigned char buf[VOL_GAIN_BYTES];
+
+    if (gain2bytes(vol2gain(vol), buf)) {
+        return 1;
+    }
+    return i2c_sched_write(I2C_SCHED_INTERACTIVE, addr, VOL_GAIN_REG, buf, VOL_GAIN_BYTES);
+}
+
+static int write_alpha(unsigned char addr){
+    return i2c_sched_write(I2C_SCHED_INTERACTIVE, addr, VOL_ALPHA_REG, ALPHA_REG_DATA, ALPHA_REG_BYTES);
+}
+
+static void ns2timespec(uint64_t ns, struct timespec *ts){
+    ts->tv_sec = (time_t)(ns/NS_PER_SEC);
+    ts->tv_nsec = (long)(ns%NS_PER_SEC);
+}
@@ -0,0 +1,109 @@
+/*
+ * volume.h
+ *
+ *  Volume control of the dsp
+ *
+ *  The volume is set with a gain (8.24, 0 <= gain <= 1) in VOL_GAIN_REG, and the
+ *  smoothing of the dsp volume cell in VOL_ALPHA_REG.
+ *  vol, 0..100, is mapped dB linear to the gain: vol 100 = 0 dB, 1 vol step = 1 dB
+ *
+ *  Smooth fades are made with volume_ramp(), that steps the vol from a start level to
+ *  a target level with a fixed rate over one open bus. The steps are driven by a
+ *  timerfd on CLOCK_MONOTONIC with absolute expiry times, so the step timing does
+ *  not drift with the time each write takes.
+ */
+
+#ifndef ADI_DSP_PROGRAMMER_VOLUME_H
+#define ADI_DSP_PROGRAMMER_VOLUME_H
+
+#define VOL_GAIN_REG       1242
+#define VOL_ALPHA_REG      1243
+#define VOL_GAIN_BYTES     4
+#define VOL_RAMP_RATE_HZ   100   // default number of gain updates per second
+#define VOL_RAMP_RATE_MAX  1000
+
+/*
+ * Update timing of a ramp
+ *
+ * jitter is the lateness of each update relative to its ideal time on the fixed rate
+ * grid. After an overrun it is measured from the first missed slot, so a stall shows
+ * up in full. write is the time it takes to send the gain to the dsp.
+ */
+typedef struct {
+    unsigned int n_updates;   // number of gain writes
+    unsigned int n_missed;    // timer periods that passed without an update (overruns)
+    double jitter_mean_us;
+    double jitter_std_us;
+    double jitter_max_us;
+    double write_mean_us;
+    double write_max_us;
+} volume_ramp_stats_t;
+
+/*
+ * Map vol (0..100) to gain, 10^((vol-100)/20)
+ */
+extern double vol2gain(float vol);
+
+/*
+ * Map gain to vol, inverse of vol2gain. Clamped to 0..100
+ */
+extern float gain2vol(double g);
+
+/*
+ * Convert gain, 0 <= g <= 1, to 4 bytes of dsp 8.24 format
+ *
+ * return 0 upon success
+ */
+extern int gain2bytes(double g, unsigned char buf[]);
+
+/*
+ * Convert 4 bytes of dsp 8.24 format to gain
+ */
+extern double bytes2gain(const unsigned char buf[]);
+
+/*
+ * Set the vol by writing gain and alpha. i2cOpen() must have been called.
+ *
+ * param addr, the dsp addr in 7 bit notation. 0x74 -> 0x3A
+ *
+ * return 0 upon success
+ */
+extern int volume_set(unsigned char addr, float vol);
+
+/*
+ * Read the current vol from the gain reg. i2cOpen() must have been called.
+ *
+ * param addr, the dsp addr in 7 bit notation. 0x74 -> 0x3A
+ *
+ * return 0 upon success
+ */
+extern int volume_get(unsigned char addr, float *vol);
+
+/*
+ * Ramp the vol, dB linear, from start to target. i2cOpen() must have been called.
+ * Blocks until the ramp is done. The last update always sets the target vol.
+ *
+ * param addr, the dsp addr in 7 bit notation. 0x74 -> 0x3A
+ *
+ * param duration_ms, ramp time, shorter than one period gives a single update to the target
+ *
+ * param rate_hz, gain updates per second, 1..VOL_RAMP_RATE_MAX
+ *
+ * param stats, if not NULL, gets the update timing
+ *
+ * return 0 upon success
+ */
+extern int volume_ramp(
+        unsigned char addr,
+        float start,
+        float target,
+        unsigned int duration_ms,
+        unsigned int rate_hz,
+        volume_ramp_stats_t *stats);
+
+/*
+ * Print the update timing of a ramp to stdout
+ */
+extern void volume_ramp_print_stats(const volume_ramp_stats_t *stats);
+
+#endif //ADI_DSP_PROGRAMMER_VOLUME_H